@@ -0,0 +1,255 @@
+#include <string.h>
+#include <omp.h>
+#include <mpi.h>
+
+// Requires proj_common.h to be included before this file.
+
+#define AUTOTUNE_STEPS 5                    // Amount of calibration steps timed per candidate configuration
+#define AUTOTUNE_CACHE "autotune_cache"     // File where chosen configurations are stored between runs
+
+/**
+ * @brief Struct to represent a thread configuration for the hybrid implementation.
+ *
+ * This struct holds the OpenMP settings chosen by the autotuner for the neighbor interaction loop,
+ * together with the measured time per calibration step.
+ */
+struct Tuning
+{
+    int threads; /**< Amount of OpenMP threads per process. */
+    int sched; /**< OpenMP schedule kind, as an omp_sched_t value. */
+    int chunk; /**< OpenMP schedule chunk size, 0 for the default chunk size. */
+    int leaf; /**< Tree leaf size in topological mode, 0 in metric mode. */
+    double time; /**< Slowest process time per calibration step in seconds. */
+};
+
+const int tuneScheds[6] = {omp_sched_static, omp_sched_dynamic, omp_sched_dynamic, omp_sched_dynamic, omp_sched_guided, omp_sched_guided}; /**< Candidate schedule kinds. */
+const int tuneChunks[6] = {0, 1, 16, 64, 1, 16}; /**< Candidate chunk sizes, paired with tuneScheds. */
+const double tuneLeafScales[3] = {0.5, 1.0, 2.0}; /**< Candidate tree leaf sizes, relative to the initTree choice. */
+
+/**
+ * @brief Looks up a previously chosen configuration in the autotune cache file.
+ *
+ * Each line of the cache holds host, processes, processes per node, thread budget, NUMBER, L, interaction mode,
+ * its parameter, threads, schedule, chunk, tree leaf size and time. The problem size and density are given by NUMBER and L,
+ * the interaction mode is TOPOLOGICAL with parameter K_NEIGHBORS, or R_INIT when metric, as the two modes have
+ * different costs, and the thread budget is the OMP_NUM_THREADS the configuration was calibrated under.
+ * Lines using more threads than the budget are never used. If several lines match, the last one is used.
+ *
+ * @param filename Name of the cache file.
+ * @param host Name of the host the run is started on.
+ * @param ranks Total amount of MPI processes.
+ * @param rpn Amount of MPI processes per node.
+ * @param maxThreads Amount of OpenMP threads available to each process.
+ * @param t Pointer to the tuning struct filled in if a match is found.
+ * @return Returns 1 if a matching configuration was found, otherwise 0.
+ */
+int loadTuning(const char *filename, const char *host, int ranks, int rpn, int maxThreads, struct Tuning *t) {
+    char fhost[256]; /**< Host read from the file. */
+    int franks, frpn, fmax, fnumber, fmode, found = 0; /**< Process counts, thread budget, bird number and interaction mode read from the file. */
+    double fl, fparam; /**< Box size and interaction parameter read from the file. */
+    double param = TOPOLOGICAL ? K_NEIGHBORS : R_INIT; /**< Parameter of the interaction mode. */
+    struct Tuning ft; /**< Configuration read from the file. */
+
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) return 0; /**< No cache yet. */
+
+    while (fscanf(f, "%255s %d %d %d %d %lf %d %lf %d %d %d %d %lf", fhost, &franks, &frpn, &fmax, &fnumber, &fl, &fmode, &fparam, &ft.threads, &ft.sched, &ft.chunk, &ft.leaf, &ft.time) == 13) {
+        if (strcmp(fhost, host) == 0 && franks == ranks && frpn == rpn && fmax == maxThreads && fnumber == NUMBER && fl == L && fmode == TOPOLOGICAL && fparam == param && ft.threads <= maxThreads) {
+            *t = ft;
+            found = 1;
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+/**
+ * @brief Appends a chosen configuration to the autotune cache file.
+ *
+ * @param filename Name of the cache file.
+ * @param host Name of the host the run is started on.
+ * @param ranks Total amount of MPI processes.
+ * @param rpn Amount of MPI processes per node.
+ * @param maxThreads Amount of OpenMP threads available to each process.
+ * @param t Pointer to the tuning struct to store.
+ */
+void saveTuning(const char *filename, const char *host, int ranks, int rpn, int maxThreads, struct Tuning *t) {
+    double param = TOPOLOGICAL ? K_NEIGHBORS : R_INIT; /**< Parameter of the interaction mode. */
+
+    FILE *f = fopen(filename, "a");
+    if (f == NULL) return; /**< Cache is only an optimization, so a read-only directory is not an error. */
+
+    fprintf(f, "%s %d %d %d %d %.17g %d %.17g %d %d %d %d %f\n", host, ranks, rpn, maxThreads, NUMBER, L, TOPOLOGICAL, param, t->threads, t->sched, t->chunk, t->leaf, t->time);
+    fclose(f);
+}
+
+/**
+ * @brief Times the neighbor interaction loop for one candidate configuration.
+ *
+ * Runs AUTOTUNE_STEPS steps of the bird exchange and angle effect calculation on a scratch copy of this process' birds,
+ * which is the part of a timestep that depends on the thread configuration. The steps run inside one parallel region
+ * shaped like the timestep loop of proj_mpi_omp.c: in the metric mode the master thread broadcasts and waits for
+ * blocks of birds while the other threads calculate effects block by block, in the topological mode the master
+ * thread gathers all birds and the tree is built before the nearest neighbors are searched.
+ * Each process broadcasts its block from birds, which already holds it, so the simulation's birds are unchanged.
+ * One untimed step is run first, so that creating a new thread team and warming caches
+ * is not charged to whichever candidate happens to come first.
+ * The slowest process decides the time, as all processes wait for it in the next collective.
+ *
+ * @param birds Array of all birds in the simulation.
+ * @param scratch Scratch array of num_pp birds to calculate angle effects on.
+ * @param num_pp Number of birds for this process.
+ * @param tree Pointer to the tree when in topological mode, resized to the candidate, otherwise unused.
+ * @param t Pointer to the tuning struct to time, its time field is filled in.
+ */
+void timeTuning(struct Bird *birds, struct Bird *scratch, int num_pp, struct Tree *tree, struct Tuning *t) {
+    int s, j; /**< Loop counters. */
+
+    double startTime = 0; /**< Start time of the timed steps. */
+
+    #if !TOPOLOGICAL
+        int size = NUMBER / num_pp; /**< Amount of processes, each owning one block of birds. */
+        double R = pow(R_INIT, 2); /**< Interaction radius squared, used in Pythagorean theorem. */
+        MPI_Request *reqs = calloc(size, sizeof(MPI_Request)); /**< Requests of the broadcast of each process' birds. */
+    #endif
+
+    omp_set_schedule((omp_sched_t)t->sched, t->chunk); /**< Apply candidate schedule. */
+    #if TOPOLOGICAL
+        if (tree->leaf != t->leaf) resizeTree(tree, t->leaf); /**< Apply candidate leaf size. */
+    #endif
+
+    #pragma omp parallel num_threads(t->threads) private(s, j)
+    for (s = -1; s < AUTOTUNE_STEPS; s++) { /**< Step -1 is the untimed warm-up step. */
+        #pragma omp master
+        if (s == 0) {
+            MPI_Barrier(MPI_COMM_WORLD); /**< Start all processes together. */
+            startTime = omp_get_wtime();
+        }
+
+        #if TOPOLOGICAL
+            #pragma omp master
+            MPI_Allgather(scratch, num_pp * 7, MPI_DOUBLE, birds, num_pp * 7, MPI_DOUBLE, MPI_COMM_WORLD);
+
+            #pragma omp barrier
+
+            buildTree(tree, birds);
+
+            #pragma omp for schedule(runtime)
+            for (j = 0; j < num_pp; j++) {
+                calculateTopologicalAngleEffects(&scratch[j], birds, tree);
+            }
+        #else
+            int r; /**< Process whose block of birds is handled. */
+
+            #pragma omp master
+            {
+                for (r = 0; r < size; r++) {
+                    MPI_Ibcast(&birds[r * num_pp], num_pp * 7, MPI_DOUBLE, r, MPI_COMM_WORLD, &reqs[r]);
+                }
+                MPI_Wait(&reqs[0], MPI_STATUS_IGNORE);
+            }
+
+            #pragma omp barrier
+
+            for (r = 0; r < size; r++) {
+                #pragma omp master
+                if (r + 1 < size) MPI_Wait(&reqs[r + 1], MPI_STATUS_IGNORE);
+
+                #pragma omp for schedule(runtime)
+                for (j = 0; j < num_pp; j++) {
+                    calculateAngleEffectsRange(&scratch[j], birds, R, r * num_pp, (r + 1) * num_pp);
+                }
+            }
+        #endif
+    }
+
+    double time = (omp_get_wtime() - startTime) / AUTOTUNE_STEPS;
+    MPI_Allreduce(&time, &t->time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD); /**< Same result on all processes, so all pick the same configuration. */
+
+    #if !TOPOLOGICAL
+        free(reqs);
+    #endif
+}
+
+/**
+ * @brief Picks the fastest thread configuration, using the cache file if possible.
+ *
+ * Process 0 looks up the configuration for this host, process layout, problem size and interaction mode in AUTOTUNE_CACHE.
+ * If none is found, thread counts in powers of two up to the maximum (and the maximum itself)
+ * are calibrated together with every candidate schedule, and in topological mode every candidate tree leaf size.
+ * The fastest is stored in the cache. The chosen configuration is applied with omp_set_num_threads,
+ * omp_set_schedule and resizeTree. Amount of processes per node is set by the job script,
+ * so it is part of the cache key rather than tuned, as is the thread budget OMP_NUM_THREADS.
+ *
+ * @param birds Array of all birds in the simulation, already initialized on all processes.
+ * @param proc_birds Array of birds for this process.
+ * @param num_pp Number of birds for this process.
+ * @param tree Pointer to the tree when in topological mode, resized to the chosen leaf size, otherwise unused.
+ * @return Returns the chosen configuration.
+ */
+struct Tuning autotune(struct Bird *birds, struct Bird *proc_birds, int num_pp, struct Tree *tree) {
+    int rank, size, rpn, len, found = 0, t, c, g; /**< MPI variables and loop counters. */
+    int maxThreads = omp_get_max_threads(); /**< Thread budget, upper limit of thread candidates. */
+    char host[MPI_MAX_PROCESSOR_NAME]; /**< Name of the host of this process. */
+    struct Tuning best, cand; /**< Best and current candidate configuration. */
+    MPI_Comm node; /**< Communicator of the processes sharing this node. */
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+    MPI_Comm_size(node, &rpn); /**< Get the amount of processes on this node. */
+    MPI_Comm_free(&node);
+    MPI_Get_processor_name(host, &len);
+
+    if (rank == 0) found = loadTuning(AUTOTUNE_CACHE, host, size, rpn, maxThreads, &best);
+    MPI_Bcast(&found, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if (found) {
+        MPI_Bcast(&best, sizeof(struct Tuning), MPI_BYTE, 0, MPI_COMM_WORLD); /**< All processes use process 0's cached choice. */
+    } else {
+        struct Bird *scratch = calloc(num_pp, sizeof(struct Bird)); /**< Scratch birds so calibration does not touch the simulation. */
+        memcpy(scratch, proc_birds, sizeof(struct Bird) * num_pp);
+
+        #if TOPOLOGICAL
+            int baseLeaf = tree->leaf; /**< Leaf size chosen by initTree. */
+            int numLeaves = 3; /**< Amount of leaf size candidates. */
+        #else
+            int numLeaves = 1; /**< Tree is not used in metric mode. */
+        #endif
+
+        best.time = -1;
+        for (g = 0; g < numLeaves; g++) {
+            #if TOPOLOGICAL
+                cand.leaf = (int)(baseLeaf * tuneLeafScales[g]);
+                if (cand.leaf < 1 || (g > 0 && cand.leaf == (int)(baseLeaf * tuneLeafScales[g - 1]))) continue; /**< Skip leaf sizes that are tried already. */
+            #else
+                cand.leaf = 0;
+            #endif
+            for (t = 1; t <= maxThreads; t = (t * 2 > maxThreads && t != maxThreads) ? maxThreads : t * 2) {
+                for (c = 0; c < 6; c++) {
+                    cand.threads = t;
+                    cand.sched = tuneScheds[c];
+                    cand.chunk = tuneChunks[c];
+                    timeTuning(birds, scratch, num_pp, tree, &cand);
+                    if (best.time < 0 || cand.time < best.time) best = cand;
+                }
+            }
+        }
+
+        free(scratch);
+        if (rank == 0) saveTuning(AUTOTUNE_CACHE, host, size, rpn, maxThreads, &best);
+    }
+
+    omp_set_num_threads(best.threads); /**< Apply chosen configuration. */
+    omp_set_schedule((omp_sched_t)best.sched, best.chunk);
+    #if TOPOLOGICAL
+        if (best.leaf > 0 && tree->leaf != best.leaf) resizeTree(tree, best.leaf);
+    #endif
+
+    if (rank == 0) {
+        fprintf(stderr, "Autotune %s: %d Threads, Schedule %d, Chunk %d, Leaf %d, %d Processes, %d per Node\n", found ? "cached" : "calibrated", best.threads, best.sched, best.chunk, best.leaf, size, rpn);
+    }
+
+    return best;
+}
@@ -6,6 +6,14 @@
 
 #define PI 3.14159265358979323846
 
+#define TOPOLOGICAL 0   // If birds align with their K_NEIGHBORS nearest neighbors instead of all within R_INIT
+#define K_NEIGHBORS 7   // Amount of nearest neighbors used in topological interaction mode
+
+#define AUTOTUNE 0      // If hybrid implementation picks threads and schedule by calibration at startup
+
+#define RENDER 0        // If density and heading frames are rendered to PPM files during the simulation
+#define RENDER_EVERY 10 // Amount of Timesteps between rendered frames
+
 #if VERIF
     #define TIMESTEPS 50   // Amount of Timesteps
     #define NUMBER 25      // Amount of Birds
@@ -52,6 +60,36 @@ struct Bird
     double sy; /**< Sum of sine components of neighboring bird angles. */
 };
 
+/**
+ * @brief Struct to represent a node of the neighbor search tree.
+ *
+ * A node owns a contiguous range of bird indices in the tree and the bounding box of those birds.
+ */
+struct TreeNode
+{
+    double x0; /**< Smallest x coordinate of the node's birds. */
+    double x1; /**< Largest x coordinate of the node's birds. */
+    double y0; /**< Smallest y coordinate of the node's birds. */
+    double y1; /**< Largest y coordinate of the node's birds. */
+    int lo; /**< Index in idx of the node's first bird. */
+    int hi; /**< Index in idx after the node's last bird. */
+};
+
+/**
+ * @brief Struct to represent a k-d tree over the periodic box.
+ *
+ * This struct splits all birds at the median of the wider side of their bounding box until at most leaf birds remain,
+ * so that the nearest neighbors of a bird can be found by visiting few nodes instead of all birds,
+ * however the birds are spread over the box. Nodes are stored as a binary heap, node n having children 2n + 1 and 2n + 2.
+ */
+struct Tree
+{
+    int leaf; /**< Largest amount of birds in a leaf node. */
+    int nodes; /**< Amount of node slots, enough for the deepest leaf. */
+    struct TreeNode *node; /**< Nodes of the tree, nodes entries. */
+    int *idx; /**< Bird indices sorted by node, NUMBER entries. */
+};
+
 /** @brief Generates and returns a random double-precision float in range [0.0, 1.0]
 *
 *   Function uses the function rand() from <stdlib.h> to generate a random integer value between 0 and RAND_MAX.
@@ -133,19 +171,21 @@ void updateBirdPos(struct Bird *b) {
 }
 
 /**
- * @brief Calculates the effects of neighboring birds on the current bird's angle.
+ * @brief Calculates the effects of neighboring birds in a range of indices on the current bird's angle.
  *
- * This function calculates the effects of neighboring birds within a certain radius (R)
- * on the angle of the current bird. It updates the sum of sines (sy) and cosines (sx)
- * of the angles of neighboring birds.
+ * Same as calculateAngleEffects, but only birds with index first to last - 1 are considered.
+ * Calling it for consecutive ranges covering all birds gives exactly the same sums as calculateAngleEffects,
+ * which lets the hybrid implementation start on birds that have arrived while others are still being received.
  *
  * @param b Pointer to the bird struct to update its angle effects.
  * @param birds Array of all birds in the simulation.
  * @param R Pre-squared radius within which neighboring birds are considered.
+ * @param first Index of the first bird to consider.
+ * @param last Index after the last bird to consider.
  */
-void calculateAngleEffects(struct Bird *b, struct Bird *birds, double R) {
+void calculateAngleEffectsRange(struct Bird *b, struct Bird *birds, double R, int first, int last) {
     struct Bird *nb; /**< Pointer to a neighboring bird. */
-    for (int k = 0; k < NUMBER; k++) {
+    for (int k = first; k < last; k++) {
         nb = &birds[k];
         if (pow(nb->x - b->x, 2) + pow(nb->y - b->y, 2) < R) /**< Check if bird is within squared radius R. */
         {
@@ -155,6 +195,21 @@ void calculateAngleEffects(struct Bird *b, struct Bird *birds, double R) {
     }
 }
 
+/**
+ * @brief Calculates the effects of neighboring birds on the current bird's angle.
+ *
+ * This function calculates the effects of neighboring birds within a certain radius (R)
+ * on the angle of the current bird. It updates the sum of sines (sy) and cosines (sx)
+ * of the angles of neighboring birds.
+ *
+ * @param b Pointer to the bird struct to update its angle effects.
+ * @param birds Array of all birds in the simulation.
+ * @param R Pre-squared radius within which neighboring birds are considered.
+ */
+void calculateAngleEffects(struct Bird *b, struct Bird *birds, double R) {
+    calculateAngleEffectsRange(b, birds, R, 0, NUMBER); /**< Sum over all birds. */
+}
+
 /**
  * @brief Updates the angle of a bird based on the effects of neighboring birds.
  *
@@ -171,4 +226,270 @@ void updateBirdAngle(struct Bird *b) {
 
     b->vx = V0 * cos(b->theta); /**< Update x component of velocity based on new angle. */
     b->vy = V0 * sin(b->theta); /**< Update y component of velocity based on new angle. */
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Allocates the nodes of a tree for its leaf size.
+ *
+ * Median splits halve the birds of a node, so the deepest leaf is at the first depth where NUMBER / 2^depth
+ * birds fit in a leaf.
+ *
+ * @param tree Pointer to the tree struct whose nodes are allocated.
+ */
+void allocTreeNodes(struct Tree *tree) {
+    int width = 1; /**< Amount of nodes at the deepest level. */
+    while ((NUMBER + width - 1) / width > tree->leaf) width *= 2;
+
+    tree->nodes = 2 * width - 1;
+    tree->node = calloc(tree->nodes, sizeof(struct TreeNode)); /**< Allocate nodes. */
+}
+
+/**
+ * @brief Allocates a k-d tree for topological neighbor search.
+ *
+ * Leaves hold up to K_NEIGHBORS + 1 birds, the amount of birds each search has to find.
+ *
+ * @param tree Pointer to the tree struct to be initialized.
+ */
+void initTree(struct Tree *tree) {
+    tree->leaf = K_NEIGHBORS + 1;
+    allocTreeNodes(tree);
+
+    tree->idx = calloc(NUMBER, sizeof(int)); /**< Allocate bird indices sorted by node. */
+    for (int i = 0; i < NUMBER; i++) {
+        tree->idx[i] = i;
+    }
+}
+
+/**
+ * @brief Changes the leaf size of an allocated tree.
+ *
+ * Used by the autotuner to try other leaf sizes than the one chosen by initTree.
+ * The tree has to be built again with buildTree before it is searched.
+ *
+ * @param tree Pointer to the tree struct to be resized.
+ * @param leaf New largest amount of birds in a leaf, at least 1.
+ */
+void resizeTree(struct Tree *tree, int leaf) {
+    tree->leaf = leaf < 1 ? 1 : leaf;
+
+    free(tree->node);
+    allocTreeNodes(tree);
+}
+
+/**
+ * @brief Frees the memory held by a tree.
+ *
+ * @param tree Pointer to the tree struct to be freed.
+ */
+void freeTree(struct Tree *tree) {
+    free(tree->node);
+    free(tree->idx);
+}
+
+/**
+ * @brief Compares two birds along one axis, breaking ties by index.
+ *
+ * @param birds Array of all birds in the simulation.
+ * @param dim Axis to compare along, 0 for x and 1 for y.
+ * @param a Index of the first bird.
+ * @param b Index of the second bird.
+ * @return Returns 1 if bird a comes before bird b, otherwise 0.
+ */
+int treeLess(struct Bird *birds, int dim, int a, int b) {
+    double ca = dim ? birds[a].y : birds[a].x, cb = dim ? birds[b].y : birds[b].x; /**< Coordinates compared. */
+    return ca < cb || (ca == cb && a < b);
+}
+
+/**
+ * @brief Partially sorts a range of bird indices so that the k-th one is in place.
+ *
+ * Quickselect with a median of three pivot. Afterwards idx[lo] to idx[k - 1] come before idx[k] along the axis
+ * and idx[k + 1] to idx[hi - 1] come after it. As ties are broken by index, which birds end up on each side
+ * depends only on the birds, not on the order of idx.
+ *
+ * @param idx Array of bird indices.
+ * @param birds Array of all birds in the simulation.
+ * @param dim Axis to sort along, 0 for x and 1 for y.
+ * @param lo Index of the first entry of the range.
+ * @param hi Index after the last entry of the range.
+ * @param k Index of the entry to put in place.
+ */
+void selectTree(int *idx, struct Bird *birds, int dim, int lo, int hi, int k) {
+    int i, j, a, b, c, pivot, tmp; /**< Partition variables. */
+
+    while (hi - lo > 2) {
+        a = idx[lo]; b = idx[lo + (hi - lo) / 2]; c = idx[hi - 1]; /**< Pivot is the median of three entries. */
+        if (treeLess(birds, dim, b, a)) { tmp = a; a = b; b = tmp; }
+        if (treeLess(birds, dim, c, b)) { b = c; if (treeLess(birds, dim, b, a)) b = a; }
+        pivot = b;
+
+        i = lo;
+        j = hi - 1;
+        while (i <= j) {
+            while (treeLess(birds, dim, idx[i], pivot)) i++;
+            while (treeLess(birds, dim, pivot, idx[j])) j--;
+            if (i <= j) {
+                tmp = idx[i]; idx[i] = idx[j]; idx[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+
+        if (k <= j) hi = j + 1; /**< Continue in the side holding k. */
+        else if (k >= i) lo = i;
+        else return; /**< Entries between j and i equal the pivot and are in place. */
+    }
+
+    if (hi - lo == 2 && treeLess(birds, dim, idx[lo + 1], idx[lo])) {
+        tmp = idx[lo]; idx[lo] = idx[lo + 1]; idx[lo + 1] = tmp;
+    }
+}
+
+/**
+ * @brief Builds the subtree of one node.
+ *
+ * Finds the bounding box of the node's birds and, unless they fit in a leaf, splits them at the median
+ * of the wider side. Large children are built as OpenMP tasks.
+ *
+ * @param tree Pointer to the tree struct being built.
+ * @param birds Array of all birds in the simulation.
+ * @param n Index of the node.
+ * @param lo Index in idx of the node's first bird.
+ * @param hi Index in idx after the node's last bird.
+ */
+void buildTreeNode(struct Tree *tree, struct Bird *birds, int n, int lo, int hi) {
+    struct TreeNode *nd = &tree->node[n]; /**< Node being built. */
+    int k, m, dim; /**< Loop counter, median and split axis. */
+    struct Bird *b; /**< Pointer to a bird of the node. */
+
+    nd->lo = lo;
+    nd->hi = hi;
+    nd->x0 = nd->y0 = L;
+    nd->x1 = nd->y1 = 0;
+    for (k = lo; k < hi; k++) { /**< Bounding box of the node's birds. */
+        b = &birds[tree->idx[k]];
+        if (b->x < nd->x0) nd->x0 = b->x;
+        if (b->x > nd->x1) nd->x1 = b->x;
+        if (b->y < nd->y0) nd->y0 = b->y;
+        if (b->y > nd->y1) nd->y1 = b->y;
+    }
+
+    if (hi - lo <= tree->leaf) return; /**< Leaf node. */
+
+    dim = (nd->y1 - nd->y0 > nd->x1 - nd->x0); /**< Split the wider side. */
+    m = lo + (hi - lo) / 2;
+    selectTree(tree->idx, birds, dim, lo, hi, m);
+
+    #pragma omp task if (hi - lo > 4096)
+    buildTreeNode(tree, birds, 2 * n + 1, lo, m);
+    #pragma omp task if (hi - lo > 4096)
+    buildTreeNode(tree, birds, 2 * n + 2, m, hi);
+}
+
+/**
+ * @brief Builds the tree from the current positions of all birds.
+ *
+ * Uses an orphaned OpenMP single construct with tasks, so when called by all threads of a parallel region
+ * subtrees are built in parallel, and when called outside of one it runs serially.
+ * The tree only depends on the positions, not on the amount of threads.
+ *
+ * @param tree Pointer to the tree struct to be built.
+ * @param birds Array of all birds in the simulation.
+ */
+void buildTree(struct Tree *tree, struct Bird *birds) {
+    #pragma omp single
+    buildTreeNode(tree, birds, 0, 0, NUMBER); /**< Implicit barrier waits for all tasks. */
+}
+
+/**
+ * @brief Returns the periodic distance from a coordinate to an interval along one axis.
+ *
+ * @param q Coordinate in the box.
+ * @param lo Start of the interval.
+ * @param hi End of the interval.
+ * @return Distance to the closest periodic image of the interval, 0 if q lies within it.
+ */
+double treeGap(double q, double lo, double hi) {
+    if (q < lo) return fmin(lo - q, q + L - hi); /**< Interval to the right, or its image to the left. */
+    if (q > hi) return fmin(q - hi, lo + L - q); /**< Interval to the left, or its image to the right. */
+    return 0;
+}
+
+/**
+ * @brief Searches a subtree for birds closer than the ones found so far.
+ *
+ * @param tree Pointer to the tree struct being searched.
+ * @param birds Array of all birds in the simulation.
+ * @param n Index of the node.
+ * @param b Pointer to the bird whose neighbors are searched.
+ * @param bestd Squared distances of the closest birds found so far, ascending.
+ * @param besti Indices of the closest birds found so far.
+ * @param found Pointer to the amount of birds held in the best lists.
+ */
+void searchTreeNode(struct Tree *tree, struct Bird *birds, int n, struct Bird *b, double *bestd, int *besti, int *found) {
+    struct TreeNode *nd = &tree->node[n]; /**< Node being searched. */
+    int k, i, m; /**< Loop and insertion variables. */
+    double dx, dy, d, dl, dr; /**< Periodic distance variables. */
+
+    if (nd->hi - nd->lo <= tree->leaf) { /**< Leaf node, check each bird. */
+        for (k = nd->lo; k < nd->hi; k++) {
+            i = tree->idx[k];
+            dx = fabs(birds[i].x - b->x);
+            dy = fabs(birds[i].y - b->y);
+            if (dx > L / 2) dx = L - dx; /**< Use closest periodic image. */
+            if (dy > L / 2) dy = L - dy;
+            d = dx * dx + dy * dy;
+
+            if (*found == K_NEIGHBORS + 1 && (d > bestd[K_NEIGHBORS] || (d == bestd[K_NEIGHBORS] && i > besti[K_NEIGHBORS]))) continue;
+
+            m = (*found < K_NEIGHBORS + 1) ? (*found)++ : K_NEIGHBORS; /**< Insert into sorted best lists. */
+            while (m > 0 && (bestd[m - 1] > d || (bestd[m - 1] == d && besti[m - 1] > i))) {
+                bestd[m] = bestd[m - 1];
+                besti[m] = besti[m - 1];
+                m--;
+            }
+            bestd[m] = d;
+            besti[m] = i;
+        }
+        return;
+    }
+
+    struct TreeNode *l = &tree->node[2 * n + 1], *r = &tree->node[2 * n + 2]; /**< Children of the node. */
+    dl = pow(treeGap(b->x, l->x0, l->x1), 2) + pow(treeGap(b->y, l->y0, l->y1), 2); /**< Squared distance to each child's box. */
+    dr = pow(treeGap(b->x, r->x0, r->x1), 2) + pow(treeGap(b->y, r->y0, r->y1), 2);
+
+    if (dl <= dr) { /**< Visit the closer child first, skip children that cannot hold a closer bird. */
+        searchTreeNode(tree, birds, 2 * n + 1, b, bestd, besti, found);
+        if (*found < K_NEIGHBORS + 1 || dr <= bestd[K_NEIGHBORS]) searchTreeNode(tree, birds, 2 * n + 2, b, bestd, besti, found);
+    } else {
+        searchTreeNode(tree, birds, 2 * n + 2, b, bestd, besti, found);
+        if (*found < K_NEIGHBORS + 1 || dl <= bestd[K_NEIGHBORS]) searchTreeNode(tree, birds, 2 * n + 1, b, bestd, besti, found);
+    }
+}
+
+/**
+ * @brief Calculates the effects of the nearest neighboring birds on the current bird's angle.
+ *
+ * Topological counterpart to calculateAngleEffects. Instead of every bird within a radius,
+ * the K_NEIGHBORS + 1 closest birds (including the bird itself) are summed, using periodic distances.
+ * The tree is descended closer child first, skipping nodes whose bounding box is farther away than the
+ * birds found so far, so a search visits about log(NUMBER) nodes also when birds are clustered.
+ * Neighbors are summed in order of distance, ties broken by index, so the result does not depend on the tree.
+ *
+ * @param b Pointer to the bird struct to update its angle effects.
+ * @param birds Array of all birds in the simulation.
+ * @param tree Pointer to a tree built from birds with buildTree.
+ */
+void calculateTopologicalAngleEffects(struct Bird *b, struct Bird *birds, struct Tree *tree) {
+    double bestd[K_NEIGHBORS + 1]; /**< Squared distances of the closest birds found so far, ascending. */
+    int besti[K_NEIGHBORS + 1]; /**< Indices of the closest birds found so far. */
+    int found = 0; /**< Amount of birds held in the best lists. */
+
+    searchTreeNode(tree, birds, 0, b, bestd, besti, &found);
+
+    for (int k = 0; k < found; k++) {
+        b->sx += cos(birds[besti[k]].theta); /**< Update sum of cosines. */
+        b->sy += sin(birds[besti[k]].theta); /**< Update sum of sines. */
+    }
+}
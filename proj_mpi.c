@@ -1,4 +1,5 @@
 #include "proj_common.h"
+#include "proj_render.h"
 #include <stdio.h>
 #include <omp.h>
 #include <mpi.h>
@@ -20,7 +21,9 @@ int main(int argc, char *argv[])
     int i, j, rank, size, provided, num_pp, startnum; /**< Loop counters and MPI variables. */
     struct Bird *b; /**< Reusable pointer to a bird struct. */
 
-    double R = pow(R_INIT, 2); /**< Interaction radius squared, used in Pythagorean theorem. */
+    #if !TOPOLOGICAL
+        double R = pow(R_INIT, 2); /**< Interaction radius squared, used in Pythagorean theorem. */
+    #endif
 
     MPI_Init_thread(&argc, &argv, MPI_THREAD_SINGLE, &provided); /**< Initialize MPI with single thread support. */
     MPI_Comm_size(MPI_COMM_WORLD, &size); /**< Get the total number of processes. */
@@ -42,6 +45,16 @@ int main(int argc, char *argv[])
     struct Bird *birds = calloc(NUMBER, sizeof(struct Bird)); /**< Allocate memory for all birds. */
     struct Bird *proc_birds = calloc(num_pp, sizeof(struct Bird)); /**< Allocate memory for birds of this process. */
 
+    #if TOPOLOGICAL
+        struct Tree tree; /**< K-d tree over all birds for nearest neighbor search. */
+        initTree(&tree);
+    #endif
+
+    #if RENDER
+        struct Frame frame; /**< Frame for in-situ rendering. */
+        initFrame(&frame);
+    #endif
+
     double startTime = omp_get_wtime(); /**< Record start time of simulation. */
 
     if (rank == 0) {
@@ -60,14 +73,31 @@ int main(int argc, char *argv[])
 
         MPI_Allgather(proc_birds, num_pp * 7, MPI_DOUBLE, birds, num_pp * 7, MPI_DOUBLE, MPI_COMM_WORLD); /**< Gather all birds' data to all processes. */
 
-        for (j = 0; j < num_pp; j++){ /**< Calculate angle effects for all birds for this process. */
-            calculateAngleEffects(&proc_birds[j], birds, R);
-        }
+        #if TOPOLOGICAL
+            buildTree(&tree, birds); /**< Build the tree over all birds for this timestep. */
+
+            for (j = 0; j < num_pp; j++){ /**< Calculate angle effects from nearest neighbors for all birds for this process. */
+                calculateTopologicalAngleEffects(&proc_birds[j], birds, &tree);
+            }
+        #else
+            for (j = 0; j < num_pp; j++){ /**< Calculate angle effects for all birds for this process. */
+                calculateAngleEffects(&proc_birds[j], birds, R);
+            }
+        #endif
 
         for (j = 0; j < num_pp; j++) { /**< Update angles of all birds for this process. */
             updateBirdAngle(&proc_birds[j]);
         }
         
+        #if RENDER
+            if (i % RENDER_EVERY == 0) { /**< Render density and heading of all birds to a frame file. */
+                accumulateFrame(&frame, proc_birds, num_pp); /**< Bin birds of this process. */
+
+                MPI_Reduce(rank == 0 ? MPI_IN_PLACE : frame.acc, frame.acc, 3 * RENDER_RES * RENDER_RES, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD); /**< Sum frames of all processes on process 0. */
+                if (rank == 0) writeFrame(&frame, i);
+            }
+        #endif
+
         MPI_Gather(proc_birds, num_pp * 7, MPI_DOUBLE, birds, num_pp * 7, MPI_DOUBLE, 0, MPI_COMM_WORLD); /**< Gather all birds' data to process 0. */
         if (rank == 0) {
             for (j = 0; j < NUMBER; j++) { /**< Print positions and velocities of all birds. */
@@ -85,6 +115,12 @@ int main(int argc, char *argv[])
 
     free(birds); /**< Free memory allocated for all birds. */
     free(proc_birds); /**< Free memory allocated for birds of this process. */
+    #if TOPOLOGICAL
+        freeTree(&tree); /**< Free memory allocated for the tree. */
+    #endif
+    #if RENDER
+        freeFrame(&frame); /**< Free memory allocated for frame. */
+    #endif
 
     return 0; /**< Return 0 to indicate successful completion. */
 }
\ No newline at end of file
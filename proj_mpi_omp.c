@@ -1,4 +1,6 @@
 #include "proj_common.h"
+#include "proj_render.h"
+#include "proj_autotune.h"
 #include <stdio.h>
 #include <omp.h>
 #include <mpi.h>
@@ -9,6 +11,14 @@
  *
  * This function performs the entire simulation loop for the Vicsek model of Flocking Birds using MPI Processes and OpenMP Threads.
  * Using functions in proj_common.h the model is solved and results are printed in one line per timestep. 
+ * All timesteps run inside one parallel region, so threads are only created once. MPI is initialized with
+ * funneled thread support, and all MPI calls and printing are done by the master thread.
+ * In the metric mode each process' birds are broadcast as a separate nonblocking block, and the other threads
+ * calculate angle effects from one block while the master thread waits for the next one. This needs a dynamic
+ * or guided schedule for the block loop, so that threads arriving before the master take over its share,
+ * which is why guided is the default. Blocks are summed in index order, so results are exactly the same as with a single Allgather.
+ * Printing is done by the master thread of process 0 before it joins the static position update of the next timestep,
+ * so only the other threads' shares of that loop run while it prints.
  * The resulting values can then be pasted into the Python program to visualize the flock.
  *
  * @param argc Number of command-line arguments. Unused.
@@ -20,12 +30,20 @@ int main(int argc, char *argv[])
     int i, j, rank, size, provided, num_pp, startnum; /**< Loop counters and MPI variables. */
     struct Bird *b; /**< Reusable pointer to a bird struct. */
 
-    double R = pow(R_INIT, 2); /**< Interaction radius squared, used in Pythagorean theorem. */
+    #if !TOPOLOGICAL
+        double R = pow(R_INIT, 2); /**< Interaction radius squared, used in Pythagorean theorem. */
+    #endif
 
-    MPI_Init_thread(&argc, &argv, MPI_THREAD_SINGLE, &provided); /**< Initialize MPI with single thread support. */
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided); /**< Initialize MPI with support for calls from the master thread. */
     MPI_Comm_size(MPI_COMM_WORLD, &size); /**< Get the total number of processes. */
     MPI_Comm_rank(MPI_COMM_WORLD, &rank); /**< Get the rank of the current process. */
 
+    if (provided < MPI_THREAD_FUNNELED) { /**< Program needs MPI calls from within an OpenMP parallel region. */
+        if (rank == 0) printf("MPI library does not provide MPI_THREAD_FUNNELED support");
+        MPI_Finalize();
+        return 1;
+    }
+
     if (rank == 0) {
         if (NUMBER % size != 0) { //**< Program will only run if amount of processes is a divisor of total birds for maths reasons. */
             printf("Please start with a process number that is a divisor of %d", NUMBER);
@@ -42,6 +60,16 @@ int main(int argc, char *argv[])
     struct Bird *birds = calloc(NUMBER, sizeof(struct Bird)); /**< Allocate memory for all birds. */
     struct Bird *proc_birds = calloc(num_pp, sizeof(struct Bird)); /**< Allocate memory for birds of this process. */
 
+    #if TOPOLOGICAL
+        struct Tree tree; /**< K-d tree over all birds for nearest neighbor search. */
+        initTree(&tree);
+    #endif
+
+    #if RENDER
+        struct Frame frame; /**< Frame for in-situ rendering. */
+        initFrame(&frame);
+    #endif
+
     double startTime = omp_get_wtime(); /**< Record start time of simulation. */
 
     if (rank == 0) {
@@ -54,33 +82,92 @@ int main(int argc, char *argv[])
 
     memcpy(proc_birds, &birds[startnum], sizeof(struct Bird) * num_pp); /**< Copy the birds for this process. */
 
-    for (i = 0; i < TIMESTEPS; i++) { /**< Main simulation loop. */
-        #pragma omp parallel for schedule(static) private(j)
-        for (j = 0; j < num_pp; j++) { /**< Update positions of all birds for this process in parallel. */
+    #if AUTOTUNE
+        double tuneTime = omp_get_wtime(); /**< Record start time of autotuning. */
+        #if TOPOLOGICAL
+            autotune(birds, proc_birds, num_pp, &tree); /**< Pick and apply threads, schedule and leaf size for this host, problem size and mode. */
+        #else
+            autotune(birds, proc_birds, num_pp, NULL); /**< Pick and apply threads and schedule for this host, problem size and mode. */
+        #endif
+        startTime += omp_get_wtime() - tuneTime; /**< Leave calibration out of the simulation time. */
+    #else
+        if (getenv("OMP_SCHEDULE") == NULL) omp_set_schedule(omp_sched_guided, 0); /**< Guided schedule unless set in job script, so the master can join neighbor loops late. */
+    #endif
+
+    #if !TOPOLOGICAL
+        MPI_Request *reqs = calloc(size, sizeof(MPI_Request)); /**< Requests of the broadcast of each process' birds. */
+    #endif
+
+    #pragma omp parallel private(i, j, b)
+    for (i = 0; i < TIMESTEPS; i++) { /**< Main simulation loop, in one parallel region for all timesteps. */
+        #pragma omp for schedule(static)
+        for (j = 0; j < num_pp; j++) { /**< Update positions of all birds for this process in parallel, the master's share after printing. */
             updateBirdPos(&proc_birds[j]);
         }
 
-        MPI_Allgather(proc_birds, num_pp * 7, MPI_DOUBLE, birds, num_pp * 7, MPI_DOUBLE, MPI_COMM_WORLD); /**< Gather all birds' data. */
+        #if TOPOLOGICAL
+            #pragma omp master
+            MPI_Allgather(proc_birds, num_pp * 7, MPI_DOUBLE, birds, num_pp * 7, MPI_DOUBLE, MPI_COMM_WORLD); /**< Gather all birds' data. */
+
+            #pragma omp barrier /**< Nearest neighbors can be anywhere, so wait for all birds before calculating effects. */
 
-        #pragma omp parallel private(j)
-        {
-            #pragma omp for schedule(static)
-            for (j = 0; j < num_pp; j++){ /**< Calculate angle effects for all birds for this process in parallel. */
-                calculateAngleEffects(&proc_birds[j], birds, R);
+            buildTree(&tree, birds); /**< Build the tree over all birds for this timestep in parallel. */
+
+            #pragma omp for schedule(runtime)
+            for (j = 0; j < num_pp; j++){ /**< Calculate angle effects from nearest neighbors for all birds for this process in parallel. */
+                calculateTopologicalAngleEffects(&proc_birds[j], birds, &tree);
+            }
+        #else
+            int r; /**< Process whose block of birds is handled, private as it is declared in the parallel region. */
+
+            #pragma omp master
+            {
+                memcpy(&birds[startnum], proc_birds, sizeof(struct Bird) * num_pp); /**< Own birds are the root data of this process' broadcast. */
+                for (r = 0; r < size; r++) { /**< Start broadcasts of all processes' birds, same order on all processes. */
+                    MPI_Ibcast(&birds[r * num_pp], num_pp * 7, MPI_DOUBLE, r, MPI_COMM_WORLD, &reqs[r]);
+                }
+                MPI_Wait(&reqs[0], MPI_STATUS_IGNORE); /**< Wait for the first block. */
             }
 
             #pragma omp barrier
 
-            #pragma omp for schedule(static)
-            for (j = 0; j < num_pp; j++) { /**< Update angles of all birds for this process in parallel. */
-                updateBirdAngle(&proc_birds[j]);
+            for (r = 0; r < size; r++) { /**< Sum angle effects block by block in index order. */
+                #pragma omp master
+                if (r + 1 < size) MPI_Wait(&reqs[r + 1], MPI_STATUS_IGNORE); /**< Receive next block while other threads work on this one. */
+
+                #pragma omp for schedule(runtime)
+                for (j = 0; j < num_pp; j++){ /**< Calculate angle effects from block r for all birds for this process in parallel. */
+                    calculateAngleEffectsRange(&proc_birds[j], birds, R, r * num_pp, (r + 1) * num_pp);
+                }
             }
+        #endif
+
+        #pragma omp for schedule(static)
+        for (j = 0; j < num_pp; j++) { /**< Update angles of all birds for this process in parallel. */
+            updateBirdAngle(&proc_birds[j]);
         }
-        
+
+        #if RENDER
+            if (i % RENDER_EVERY == 0) { /**< Render density and heading of all birds to a frame file. */
+                accumulateFrame(&frame, proc_birds, num_pp); /**< Bin birds of this process in parallel. */
+
+                #pragma omp master
+                MPI_Reduce(rank == 0 ? MPI_IN_PLACE : frame.acc, frame.acc, 3 * RENDER_RES * RENDER_RES, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD); /**< Sum frames of all processes on process 0. */
+
+                #pragma omp barrier
+
+                if (rank == 0) writeFrame(&frame, i); /**< Color frame in parallel and write it. */
+            }
+        #endif
+
+        #pragma omp master
         MPI_Gather(proc_birds, num_pp * 7, MPI_DOUBLE, birds, num_pp * 7, MPI_DOUBLE, 0, MPI_COMM_WORLD); /**< Gather all birds' data to process 0. */
+
+        #pragma omp barrier /**< Positions must not change before they are gathered. */
+
+        #pragma omp master
         if (rank == 0) {
-            #pragma omp parallel for schedule(static) private(b)
-            for (j = 0; j < NUMBER; j++) { /**< Print positions and velocities of all birds. */
+            for (j = 0; j < NUMBER; j++) { /**< Print positions and velocities of all birds in order. */
                 b = &birds[j];
                 printf("[%f,%f,%f,%f],", b->x, b->y, b->vx, b->vy);
             }
@@ -95,6 +182,15 @@ int main(int argc, char *argv[])
 
     free(birds); /**< Free memory allocated for all birds. */
     free(proc_birds); /**< Free memory allocated for birds of this process. */
+    #if !TOPOLOGICAL
+        free(reqs); /**< Free memory allocated for broadcast requests. */
+    #endif
+    #if TOPOLOGICAL
+        freeTree(&tree); /**< Free memory allocated for the tree. */
+    #endif
+    #if RENDER
+        freeFrame(&frame); /**< Free memory allocated for frame. */
+    #endif
 
     return 0; /**< Return 0 to indicate successful completion. */
 }
\ No newline at end of file
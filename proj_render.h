@@ -0,0 +1,215 @@
+#include <omp.h>
+
+// Requires proj_common.h to be included before this file.
+
+#define RENDER_RES 256          // Width and height of rendered frames in pixels
+#define RENDER_PREFIX "frame"   // Rendered frames are written to <RENDER_PREFIX>_<timestep>.ppm
+
+/**
+ * @brief Struct to represent a rendered frame of the flock.
+ *
+ * Birds are binned into RENDER_RES x RENDER_RES pixels over the box. Per pixel the amount of birds
+ * and the sums of cosine and sine of their angles are accumulated, stored after each other in acc
+ * so that frames from several processes can be summed with a single reduction.
+ * Birds are first sorted by pixel using per thread histograms, so no two threads ever write the same pixel.
+ */
+struct Frame
+{
+    double *acc; /**< Bird count, sum of cosines and sum of sines per pixel, 3 * RENDER_RES * RENDER_RES entries. */
+    unsigned char *rgb; /**< Colored pixels of the frame, 3 * RENDER_RES * RENDER_RES entries. */
+    int threads; /**< Amount of threads the histograms are allocated for. */
+    int *hist; /**< Per thread bird count and later fill position per pixel, threads * RENDER_RES * RENDER_RES entries. */
+    int *start; /**< Index in order where each pixel begins, RENDER_RES * RENDER_RES + 1 entries. */
+    int *pix; /**< Pixel of each bird, NUMBER entries. */
+    double *cs; /**< Cosines of bird angles sorted by pixel, NUMBER entries. */
+    double *sn; /**< Sines of bird angles sorted by pixel, NUMBER entries. */
+    double max; /**< Largest bird count of a pixel, found by writeFrame. */
+};
+
+/**
+ * @brief Allocates a frame for in-situ rendering.
+ *
+ * Histograms are allocated for omp_get_max_threads() threads. If the frame is later binned
+ * by a larger team, accumulateFrame allocates histograms for it.
+ *
+ * @param frame Pointer to the frame struct to be initialized.
+ */
+void initFrame(struct Frame *frame) {
+    frame->acc = calloc(3 * RENDER_RES * RENDER_RES, sizeof(double)); /**< Allocate per pixel sums. */
+    frame->rgb = calloc(3 * RENDER_RES * RENDER_RES, sizeof(unsigned char)); /**< Allocate colored pixels. */
+    frame->threads = omp_get_max_threads();
+    frame->hist = calloc((size_t)frame->threads * RENDER_RES * RENDER_RES, sizeof(int)); /**< Allocate per thread histograms. */
+    frame->start = calloc(RENDER_RES * RENDER_RES + 1, sizeof(int)); /**< Allocate pixel start indices. */
+    frame->pix = calloc(NUMBER, sizeof(int)); /**< Allocate pixel of each bird. */
+    frame->cs = calloc(NUMBER, sizeof(double)); /**< Allocate cosines sorted by pixel. */
+    frame->sn = calloc(NUMBER, sizeof(double)); /**< Allocate sines sorted by pixel. */
+}
+
+/**
+ * @brief Frees the memory held by a frame.
+ *
+ * @param frame Pointer to the frame struct to be freed.
+ */
+void freeFrame(struct Frame *frame) {
+    free(frame->acc);
+    free(frame->rgb);
+    free(frame->hist);
+    free(frame->start);
+    free(frame->pix);
+    free(frame->cs);
+    free(frame->sn);
+}
+
+/**
+ * @brief Bins birds into the pixels of a cleared frame.
+ *
+ * Uses orphaned OpenMP worksharing, so when called by all threads of a parallel region
+ * the birds are binned in parallel, and when called outside of one it runs serially.
+ * Each thread counts its own contiguous block of birds per pixel, the counts give a stable sort
+ * of the birds' cosines and sines by pixel, and each pixel then sums its own contiguous range in index order. This avoids atomics on
+ * crowded pixels and gives the same sums for any amount of threads. If the team is larger than the frame's
+ * histograms were allocated for, they are reallocated first.
+ *
+ * @param frame Pointer to the frame struct to accumulate into.
+ * @param birds Array of birds to bin, at most NUMBER.
+ * @param n Amount of birds in the array.
+ */
+void accumulateFrame(struct Frame *frame, struct Bird *birds, int n) {
+    int i, px, py, p, t, k, pos, run, cnt; /**< Loop counter, pixel and histogram variables. */
+    int pixels = RENDER_RES * RENDER_RES; /**< Amount of pixels in the frame. */
+    int nt = omp_get_num_threads(), tid = omp_get_thread_num(); /**< Amount of threads and id of this thread. */
+    int lo = (int)((long)n * tid / nt), hi = (int)((long)n * (tid + 1) / nt); /**< Block of birds binned by this thread. */
+    double *count = frame->acc; /**< Bird count per pixel. */
+    double *sx = frame->acc + pixels; /**< Sum of cosines per pixel. */
+    double *sy = frame->acc + 2 * pixels; /**< Sum of sines per pixel. */
+
+    #pragma omp single
+    if (nt > frame->threads) { /**< More threads than histograms, e.g. a num_threads clause after initFrame. */
+        free(frame->hist);
+        frame->hist = calloc((size_t)nt * pixels, sizeof(int));
+        frame->threads = nt;
+    }
+
+    int *hist = frame->hist + (size_t)tid * pixels; /**< Histogram of this thread. */
+
+    for (p = 0; p < pixels; p++) { /**< Clear histogram of this thread. */
+        hist[p] = 0;
+    }
+
+    for (i = lo; i < hi; i++) { /**< Count birds of this thread's block per pixel. */
+        px = (int)(birds[i].x / L * RENDER_RES);
+        py = (int)(birds[i].y / L * RENDER_RES);
+        if (px >= RENDER_RES) px = RENDER_RES - 1; /**< Guard against positions rounding to exactly L. */
+        if (py >= RENDER_RES) py = RENDER_RES - 1;
+        p = (RENDER_RES - 1 - py) * RENDER_RES + px; /**< Image rows go from top to bottom. */
+
+        frame->pix[i] = p;
+        hist[p]++;
+    }
+
+    #pragma omp barrier
+
+    #pragma omp for schedule(static)
+    for (p = 0; p < pixels; p++) { /**< Turn counts into offsets within each pixel, thread by thread. */
+        run = 0;
+        for (t = 0; t < nt; t++) {
+            cnt = frame->hist[(size_t)t * pixels + p];
+            frame->hist[(size_t)t * pixels + p] = run;
+            run += cnt;
+        }
+        frame->start[p + 1] = run; /**< Temporarily holds the amount of birds in the pixel. */
+    }
+
+    #pragma omp single
+    {
+        frame->start[0] = 0;
+        for (p = 0; p < pixels; p++) { /**< Prefix sum of counts gives start of each pixel. */
+            frame->start[p + 1] += frame->start[p];
+        }
+    }
+
+    for (i = lo; i < hi; i++) { /**< Place angles in pixel order, keeping index order within each pixel. */
+        p = frame->pix[i];
+        pos = frame->start[p] + hist[p]++;
+        frame->cs[pos] = cos(birds[i].theta);
+        frame->sn[pos] = sin(birds[i].theta);
+    }
+
+    #pragma omp barrier
+
+    #pragma omp for schedule(static)
+    for (p = 0; p < pixels; p++) { /**< Sum birds of each pixel in index order. */
+        count[p] = frame->start[p + 1] - frame->start[p];
+        sx[p] = 0;
+        sy[p] = 0;
+        for (k = frame->start[p]; k < frame->start[p + 1]; k++) {
+            sx[p] += frame->cs[k];
+            sy[p] += frame->sn[k];
+        }
+    }
+}
+
+/**
+ * @brief Colors an accumulated frame and writes it to a PPM file.
+ *
+ * Hue shows the mean heading of the birds in a pixel (red along x, cyan against x), saturation how aligned they are,
+ * and brightness the density on a logarithmic scale up to the densest pixel of the frame, so that pixels
+ * with a single bird stay visible next to dense flocks at any RENDER_RES. Empty pixels are black. Coloring uses orphaned OpenMP worksharing like accumulateFrame,
+ * and the file is written by a single thread.
+ *
+ * @param frame Pointer to the accumulated frame struct.
+ * @param step Timestep of the frame, used in the file name.
+ */
+void writeFrame(struct Frame *frame, int step) {
+    int p, k; /**< Pixel and color sector variables. */
+    double c, h, s, v, f, q, t, rgb[3]; /**< HSV to RGB variables. */
+    double *count = frame->acc; /**< Bird count per pixel. */
+    double *sx = frame->acc + RENDER_RES * RENDER_RES; /**< Sum of cosines per pixel. */
+    double *sy = frame->acc + 2 * RENDER_RES * RENDER_RES; /**< Sum of sines per pixel. */
+
+    #pragma omp single
+    {
+        frame->max = 0;
+        for (p = 0; p < RENDER_RES * RENDER_RES; p++) { /**< Find the densest pixel. */
+            if (count[p] > frame->max) frame->max = count[p];
+        }
+    }
+
+    #pragma omp for schedule(static)
+    for (p = 0; p < RENDER_RES * RENDER_RES; p++) {
+        c = count[p];
+        h = c > 0 ? modd(atan2(sy[p], sx[p]), 2 * PI) / (2 * PI) * 6 : 0; /**< Hue sector in [0, 6] from mean heading, red along x. */
+        s = c > 0 ? sqrt(sx[p] * sx[p] + sy[p] * sy[p]) / c : 0; /**< Alignment of birds in [0, 1]. */
+        v = c > 0 ? log(1 + c) / log(1 + frame->max) : 0; /**< Density mapped to [0, 1], full brightness at the densest pixel. */
+
+        k = (int)h % 6;
+        f = h - floor(h);
+        q = v * (1 - s * f);
+        t = v * (1 - s * (1 - f));
+        switch (k) {
+            case 0: rgb[0] = v; rgb[1] = t; rgb[2] = v * (1 - s); break;
+            case 1: rgb[0] = q; rgb[1] = v; rgb[2] = v * (1 - s); break;
+            case 2: rgb[0] = v * (1 - s); rgb[1] = v; rgb[2] = t; break;
+            case 3: rgb[0] = v * (1 - s); rgb[1] = q; rgb[2] = v; break;
+            case 4: rgb[0] = t; rgb[1] = v * (1 - s); rgb[2] = v; break;
+            default: rgb[0] = v; rgb[1] = v * (1 - s); rgb[2] = q; break;
+        }
+
+        frame->rgb[3 * p] = (unsigned char)(255 * rgb[0]);
+        frame->rgb[3 * p + 1] = (unsigned char)(255 * rgb[1]);
+        frame->rgb[3 * p + 2] = (unsigned char)(255 * rgb[2]);
+    }
+
+    #pragma omp single
+    {
+        char filename[64]; /**< Name of the frame file. */
+        snprintf(filename, sizeof(filename), "%s_%05d.ppm", RENDER_PREFIX, step);
+
+        FILE *fp = fopen(filename, "wb");
+        if (fp != NULL) {
+            fprintf(fp, "P6\n%d %d\n255\n", RENDER_RES, RENDER_RES); /**< Binary PPM header. */
+            fwrite(frame->rgb, 1, 3 * RENDER_RES * RENDER_RES, fp);
+            fclose(fp);
+        }
+    }
+}
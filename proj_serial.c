@@ -1,4 +1,5 @@
 #include "proj_common.h"
+#include "proj_render.h"
 #include <stdio.h>
 #include <omp.h>
 
@@ -18,7 +19,9 @@ int main(int argc, char const *argv[])
     struct Bird *b; /**< Reusable pointer to a bird struct. */
     int i, j; /**< Loop counters. */
 
-    double R = pow(R_INIT, 2); /**< Interaction radius squared, used in Pythagorean theorem. */
+    #if !TOPOLOGICAL
+        double R = pow(R_INIT, 2); /**< Interaction radius squared, used in Pythagorean theorem. */
+    #endif
 
     printf("%d %d %f %f\n", NUMBER, TIMESTEPS, L, DT); /**< Print simulation parameters. */
 
@@ -26,6 +29,16 @@ int main(int argc, char const *argv[])
 
     struct Bird *birds = calloc(NUMBER, sizeof(struct Bird)); /**< Allocate memory for bird structs. */
 
+    #if TOPOLOGICAL
+        struct Tree tree; /**< K-d tree for nearest neighbor search. */
+        initTree(&tree);
+    #endif
+
+    #if RENDER
+        struct Frame frame; /**< Frame for in-situ rendering. */
+        initFrame(&frame);
+    #endif
+
     double startTime = omp_get_wtime(); /**< Record start time of simulation. */
  
     for (i = 0; i < NUMBER; i++) { /**< Initialize birds. */
@@ -37,9 +50,17 @@ int main(int argc, char const *argv[])
             updateBirdPos(&birds[j]);
         }
 
-        for (j = 0; j < NUMBER; j++){ /**< Calculate angle effects for all birds. */
-            calculateAngleEffects(&birds[j], birds, R);
-        }
+        #if TOPOLOGICAL
+            buildTree(&tree, birds); /**< Build the tree for this timestep. */
+
+            for (j = 0; j < NUMBER; j++){ /**< Calculate angle effects from nearest neighbors for all birds. */
+                calculateTopologicalAngleEffects(&birds[j], birds, &tree);
+            }
+        #else
+            for (j = 0; j < NUMBER; j++){ /**< Calculate angle effects for all birds. */
+                calculateAngleEffects(&birds[j], birds, R);
+            }
+        #endif
 
         for (j = 0; j < NUMBER; j++) { /**< Update angles of all birds. */
             b = &birds[j];
@@ -47,12 +68,25 @@ int main(int argc, char const *argv[])
             printf("[%f,%f,%f,%f],", b->x, b->y, b->vx, b->vy); /**< Print position and velocity of each bird. */
         }
 
+        #if RENDER
+            if (i % RENDER_EVERY == 0) { /**< Render density and heading of all birds to a frame file. */
+                accumulateFrame(&frame, birds, NUMBER);
+                writeFrame(&frame, i);
+            }
+        #endif
+
         printf("\n"); /**< Print newline after each time step. */
     }
 
     printf("Time Taken: %f", omp_get_wtime() - startTime); /**< Print total simulation time. */
 
     free(birds); /**< Free memory allocated for bird structs. */
+    #if TOPOLOGICAL
+        freeTree(&tree); /**< Free memory allocated for the tree. */
+    #endif
+    #if RENDER
+        freeFrame(&frame); /**< Free memory allocated for frame. */
+    #endif
 
     return 0; /**< Return 0 to indicate successful completion. */
 }
\ No newline at end of file
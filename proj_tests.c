@@ -1,4 +1,6 @@
 #include "proj_common.h"
+#include "proj_autotune.h"
+#include "proj_render.h"
 #include <stdio.h>
 #include <omp.h>
 #include <mpi.h>
@@ -203,6 +205,162 @@ int testCalculateAngleEffects() {
     return 0;
 }
 
+/**
+ * @brief Tests the calculateAngleEffectsRange function.
+ *
+ * @return Returns 0 if the tests pass, otherwise returns a non-zero value indicating the failure code.
+ */
+int testCalculateAngleEffectsRange() {
+    int i, r;
+    struct Bird *birds = calloc(NUMBER, sizeof(struct Bird));
+    struct Bird b1 = {0}, b2 = {0};
+
+    calculateAngleEffectsRange(&b1, birds, 1, 0, NUMBER / 2);
+    if (b1.sx != NUMBER / 2 || b1.sy != 0) return 1;             // If all angles are 0, only birds in range give cos to sx
+
+    srand(time(NULL));
+    for (i = 0; i < NUMBER; i++) {
+        birds[i].x = randd() * L;
+        birds[i].y = randd() * L;
+        birds[i].theta = randd() * 4 * PI - 2 * PI;
+    }
+    b1 = birds[0];
+    b2 = birds[0];
+    calculateAngleEffects(&b1, birds, 4);
+    for (r = 0; r < 5; r++) {
+        calculateAngleEffectsRange(&b2, birds, 4, NUMBER * r / 5, NUMBER * (r + 1) / 5);
+    }
+    if (!sameBirds(&b1, &b2)) return 2;                         // Check so consecutive ranges give exactly the same sums as all birds
+
+    b2.sx = 0;
+    b2.sy = 0;
+    calculateAngleEffectsRange(&b2, birds, 4, 3, 3);
+    if (b2.sx != 0 || b2.sy != 0) return 3;                     // Check so an empty range adds nothing
+
+    free(birds);
+    return 0;
+}
+
+/**
+ * @brief Tests the initTree, buildTree and freeTree functions.
+ *
+ * @return Returns 0 if the tests pass, otherwise returns a non-zero value indicating the failure code.
+ */
+int testBuildTree() {
+    int i, n, k;
+    struct Bird *birds = calloc(NUMBER, sizeof(struct Bird));
+    struct Tree tree;
+    initTree(&tree);
+    if (tree.leaf != K_NEIGHBORS + 1 || tree.nodes < 1) return 1;
+
+    srand(time(NULL));
+    for (i = 0; i < NUMBER; i++) {
+        birds[i].x = randd() * L;
+        birds[i].y = randd() * L;
+    }
+    birds[1].x = birds[0].x;                                // Equal coordinates should be split by index
+    birds[1].y = birds[0].y;
+    buildTree(&tree, birds);
+    if (tree.node[0].lo != 0 || tree.node[0].hi != NUMBER) return 2;       // Check so root holds all birds
+
+    int *seen = calloc(NUMBER, sizeof(int));
+    for (k = 0; k < NUMBER; k++) {
+        if (seen[tree.idx[k]]++) return 3;                  // Check so no bird is placed twice
+    }
+    for (n = 0; n < tree.nodes; n++) {
+        struct TreeNode *nd = &tree.node[n];
+        if (nd->hi == 0) continue;                          // Slot not used by this tree
+        for (k = nd->lo; k < nd->hi; k++) {
+            i = tree.idx[k];
+            if (birds[i].x < nd->x0 || birds[i].x > nd->x1 || birds[i].y < nd->y0 || birds[i].y > nd->y1) return 4;   // Check so box contains the node's birds
+        }
+        if (nd->hi - nd->lo <= tree.leaf) continue;
+        if (2 * n + 2 >= tree.nodes) return 5;              // Check so children of a split node fit in the tree
+        struct TreeNode *l = &tree.node[2 * n + 1], *r = &tree.node[2 * n + 2];
+        if (l->lo != nd->lo || l->hi != r->lo || r->hi != nd->hi || l->hi - l->lo != (nd->hi - nd->lo) / 2) return 6;     // Check so children split the node at the median
+    }
+
+    struct Tree par;
+    initTree(&par);
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(3);
+    #pragma omp parallel
+    buildTree(&par, birds);
+    omp_set_num_threads(threads);
+    if (memcmp(tree.node, par.node, tree.nodes * sizeof(struct TreeNode)) != 0) return 7;     // Check so parallel build gives the same tree as serial
+
+    free(seen);
+    free(birds);
+    freeTree(&tree);
+    freeTree(&par);
+    return 0;
+}
+
+/**
+ * @brief Tests the calculateTopologicalAngleEffects function.
+ *
+ * @return Returns 0 if the tests pass, otherwise returns a non-zero value indicating the failure code.
+ */
+int testCalculateTopologicalAngleEffects() {
+    int i, j, k, t;
+    struct Bird *birds = calloc(NUMBER, sizeof(struct Bird));
+    struct Tree tree;
+    initTree(&tree);
+
+    buildTree(&tree, birds);
+    calculateTopologicalAngleEffects(&birds[0], birds, &tree);
+    if (birds[0].sx != K_NEIGHBORS + 1 || birds[0].sy != 0) return 1;     // If all angles are 0, only K_NEIGHBORS + 1 birds give cos to sx
+
+    double *dist = calloc(NUMBER, sizeof(double));
+    int *order = calloc(NUMBER, sizeof(int));
+    double dx, dy, xval, yval, spread;
+    srand(time(NULL));
+    for (t = 0; t < 10; t++) {
+        spread = (t % 3 == 0) ? L : (t % 3 == 1) ? L / 10 : L / 100;     // Spread birds over the box, or cluster them around the corner
+        for (i = 0; i < NUMBER; i++) {
+            birds[i].x = modd(L - spread / 2 + randd() * spread, L);
+            birds[i].y = modd(L - spread / 2 + randd() * spread, L);
+            birds[i].theta = randd() * 4 * PI - 2 * PI;
+            birds[i].sx = 0;
+            birds[i].sy = 0;
+        }
+        birds[NUMBER - 1].x = birds[0].x;                   // Birds at equal distance should be ordered by index
+        birds[NUMBER - 1].y = birds[0].y;
+        resizeTree(&tree, 1 + t);                           // Result should not depend on leaf size, odd or even
+        buildTree(&tree, birds);
+
+        for (j = 0; j < NUMBER; j++) {
+            for (i = 0; i < NUMBER; i++) {                  // Brute force periodic distances and sort by distance, then index
+                dx = fabs(birds[i].x - birds[j].x);
+                dy = fabs(birds[i].y - birds[j].y);
+                if (dx > L / 2) dx = L - dx;
+                if (dy > L / 2) dy = L - dy;
+                dist[i] = dx * dx + dy * dy;
+                for (k = i; k > 0 && dist[order[k - 1]] > dist[i]; k--) order[k] = order[k - 1];
+                order[k] = i;
+            }
+            xval = 0;
+            yval = 0;
+            for (k = 0; k < K_NEIGHBORS + 1 && k < NUMBER; k++) {
+                xval += cos(birds[order[k]].theta);
+                yval += sin(birds[order[k]].theta);
+            }
+            calculateTopologicalAngleEffects(&birds[j], birds, &tree);
+            if (birds[j].sx != xval || birds[j].sy != yval) return 2;     // Check so sum is over the nearest birds, same as brute force
+        }
+    }
+
+    for (i = 0; i < NUMBER; i++) {
+        if (birds[i].vx != 0 || birds[i].vy != 0) return 3;           // Check so vx and vy are untouched.
+    }
+
+    free(dist);
+    free(order);
+    free(birds);
+    freeTree(&tree);
+    return 0;
+}
+
 /**
  * @brief Tests the updateBirdAngle function.
  *
@@ -235,6 +393,154 @@ int testUpdateBirdAngle() {
     return 0;
 }
 
+/**
+ * @brief Tests the loadTuning and saveTuning functions.
+ *
+ * @return Returns 0 if the tests pass, otherwise returns a non-zero value indicating the failure code.
+ */
+int testTuningCache() {
+    const char *filename = "test_autotune_cache";
+    struct Tuning t1 = {.threads=4, .sched=omp_sched_dynamic, .chunk=16, .leaf=8, .time=0.25};
+    struct Tuning t2 = {.threads=8, .sched=omp_sched_guided, .chunk=1, .leaf=4, .time=0.125};
+    struct Tuning res = {0};
+
+    remove(filename);
+    if (loadTuning(filename, "host", 2, 2, 8, &res)) return 1;      // Check so missing cache file gives no configuration
+
+    saveTuning(filename, "host", 2, 2, 8, &t1);
+    if (!loadTuning(filename, "host", 2, 2, 8, &res)) return 2;     // Check so saved configuration is found
+    if (res.threads != t1.threads || res.sched != t1.sched || res.chunk != t1.chunk || res.leaf != t1.leaf || res.time != t1.time) return 3;
+
+    if (loadTuning(filename, "other", 2, 2, 8, &res)) return 4;     // Check so configuration is keyed by host
+    if (loadTuning(filename, "host", 4, 2, 8, &res)) return 5;      // Check so configuration is keyed by processes
+    if (loadTuning(filename, "host", 2, 1, 8, &res)) return 6;      // Check so configuration is keyed by processes per node
+    if (loadTuning(filename, "host", 2, 2, 16, &res)) return 7;     // Check so configuration is keyed by thread budget
+
+    saveTuning(filename, "other", 2, 2, 8, &t1);
+    saveTuning(filename, "host", 2, 2, 8, &t2);
+    loadTuning(filename, "host", 2, 2, 8, &res);
+    if (res.threads != t2.threads || res.sched != t2.sched || res.chunk != t2.chunk || res.leaf != t2.leaf) return 8;     // Check so latest matching configuration is used
+
+    saveTuning(filename, "host", 2, 2, 2, &t2);                     // Entry with more threads than its budget, e.g. edited by hand
+    if (loadTuning(filename, "host", 2, 2, 2, &res)) return 9;      // Check so configuration never uses more threads than available
+
+    FILE *f = fopen(filename, "a");                                 // Entries calibrated in the other interaction mode, or with another parameter
+    fprintf(f, "host 2 2 4 %d %.17g %d %.17g 4 0 0 0 0.5\n", NUMBER, L, !TOPOLOGICAL, TOPOLOGICAL ? R_INIT : (double)K_NEIGHBORS);
+    fprintf(f, "host 2 2 4 %d %.17g %d %.17g 4 0 0 0 0.5\n", NUMBER, L, TOPOLOGICAL, (TOPOLOGICAL ? K_NEIGHBORS : R_INIT) + 1);
+    fclose(f);
+    if (loadTuning(filename, "host", 2, 2, 4, &res)) return 10;     // Check so configuration is keyed by interaction mode and its parameter
+
+    remove(filename);
+    return 0;
+}
+
+/**
+ * @brief Tests the accumulateFrame function.
+ *
+ * @return Returns 0 if the tests pass, otherwise returns a non-zero value indicating the failure code.
+ */
+int testAccumulateFrame() {
+    int i, p;
+    int pixels = RENDER_RES * RENDER_RES;
+    struct Bird *birds = calloc(NUMBER, sizeof(struct Bird));
+    struct Frame frame;
+    initFrame(&frame);
+
+    frame.acc[0] = 5;
+    accumulateFrame(&frame, birds, NUMBER);
+    p = (RENDER_RES - 1) * RENDER_RES;                      // Birds at origin end up in bottom left pixel
+    if (frame.acc[p] != NUMBER || frame.acc[pixels + p] != NUMBER || frame.acc[2 * pixels + p] != 0) return 1;
+    if (frame.acc[0] != 0) return 2;                        // Check so frame is cleared before binning
+
+    srand(time(NULL));
+    double count = 0, xval = 0, yval = 0;
+    for (i = 0; i < NUMBER; i++) {
+        birds[i].x = randd() * L;
+        birds[i].y = randd() * L;
+        birds[i].theta = randd() * 2 * PI;
+    }
+    birds[0].x = L;                                         // Position rounding up to the box edge should land in top right pixel
+    birds[0].y = L;
+    accumulateFrame(&frame, birds, NUMBER);
+    if (frame.acc[RENDER_RES - 1] < 1) return 3;
+
+    for (p = 0; p < pixels; p++) {
+        count += frame.acc[p];
+        xval += frame.acc[pixels + p];
+        yval += frame.acc[2 * pixels + p];
+    }
+    if (count != NUMBER) return 4;                          // Check so every bird is counted once
+    for (i = 0; i < NUMBER; i++) {
+        xval -= cos(birds[i].theta);
+        yval -= sin(birds[i].theta);
+    }
+    if (fabs(xval) > 0.0001 || fabs(yval) > 0.0001) return 5;      // Check so pixel sums add up to sum of all angles
+
+    double *serial = calloc(3 * pixels, sizeof(double));
+    memcpy(serial, frame.acc, 3 * pixels * sizeof(double));
+    freeFrame(&frame);
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(3);
+    initFrame(&frame);
+    #pragma omp parallel
+    accumulateFrame(&frame, birds, NUMBER);
+    omp_set_num_threads(threads);
+    if (memcmp(serial, frame.acc, 3 * pixels * sizeof(double)) != 0) return 6;     // Check so parallel binning gives exactly the same sums as serial
+
+    freeFrame(&frame);
+    omp_set_num_threads(1);
+    initFrame(&frame);                                      // Histograms for fewer threads than the team binning the frame
+    #pragma omp parallel num_threads(3)
+    accumulateFrame(&frame, birds, NUMBER);
+    omp_set_num_threads(threads);
+    if (frame.threads < 3 || memcmp(serial, frame.acc, 3 * pixels * sizeof(double)) != 0) return 7;     // Check so histograms grow with the team
+
+    free(serial);
+    free(birds);
+    freeFrame(&frame);
+    return 0;
+}
+
+/**
+ * @brief Tests the writeFrame function.
+ *
+ * @return Returns 0 if the tests pass, otherwise returns a non-zero value indicating the failure code.
+ */
+int testWriteFrame() {
+    int pixels = RENDER_RES * RENDER_RES;
+    struct Frame frame;
+    initFrame(&frame);
+
+    frame.acc[0] = NUMBER;                                  // Many aligned birds heading along x in first pixel
+    frame.acc[pixels] = NUMBER;
+    frame.acc[1] = 1;                                       // One bird heading against x in second pixel
+    frame.acc[pixels + 1] = -1;
+    writeFrame(&frame, 99999);
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "%s_%05d.ppm", RENDER_PREFIX, 99999);
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return 1;                               // Check so frame file is written
+
+    int w, h, max;
+    if (fscanf(fp, "P6 %d %d %d", &w, &h, &max) != 3 || w != RENDER_RES || h != RENDER_RES || max != 255) return 2;     // Check PPM header
+    fgetc(fp);
+    unsigned char *rgb = calloc(3 * pixels, sizeof(unsigned char));
+    if (fread(rgb, 1, 3 * pixels, fp) != 3 * pixels) return 3;     // Check so all pixels are written
+    fclose(fp);
+    remove(filename);
+
+    if (rgb[0] <= rgb[3 * 1 + 1]) return 4;                 // Check so dense pixel is brighter than sparse pixel
+    if (rgb[1] != 0 || rgb[2] != 0) return 5;               // Check so heading along x gets a red hue
+    if (rgb[3 * 1] != 0 || rgb[3 * 1 + 1] != rgb[3 * 1 + 2]) return 6;     // Check so heading against x gets a cyan hue
+    if (rgb[3 * 2] != 0 || rgb[3 * 2 + 1] != 0 || rgb[3 * 2 + 2] != 0) return 7;     // Check so empty pixels are black
+    if (rgb[0] != 255 || rgb[3 * 1 + 1] == 0) return 8;     // Check so densest pixel is fully bright and a single bird still shows
+
+    free(rgb);
+    freeFrame(&frame);
+    return 0;
+}
+
 /**
  * @brief Main function to run all tests.
  * 
@@ -254,6 +560,12 @@ int main(int argc, char const *argv[])
     printf("%d\n", testInitBird());
     printf("%d\n", testUpdateBirdPos());
     printf("%d\n", testCalculateAngleEffects());
+    printf("%d\n", testCalculateAngleEffectsRange());
+    printf("%d\n", testBuildTree());
+    printf("%d\n", testCalculateTopologicalAngleEffects());
     printf("%d\n", testUpdateBirdAngle());
+    printf("%d\n", testTuningCache());
+    printf("%d\n", testAccumulateFrame());
+    printf("%d\n", testWriteFrame());
     return 0;
 }